@@ -1,6 +1,10 @@
 /* Requires: SDL2 and SDL2_image
    Compile with: eval cc chess.c $(pkg-config sdl2 sdl2_image --cflags --libs)
 
+   For an optimized build add: -O3 -march=native -flto
+   Profile-guided builds help the move generation further: compile with
+   -fprofile-generate, play a few moves, recompile with -fprofile-use
+
    Each board square is represented with a byte:
    MSB - Piece selected
    7th - Dot is present on square
@@ -13,18 +17,64 @@
 #include "SDL.h"
 #include "SDL_image.h"
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
 typedef unsigned char u8;
+typedef unsigned long long u64;
 
 #define WIN_WIDTH  600
 #define WIN_HEIGHT 600
 #define TILE_LEN (WIN_WIDTH >> 3)
 #define TEXTURES_NUM 13
 
+/* Piece atlas: 4x4 grid of TILE_LEN cells of RGBA pixels
+   Cells 0-11 are the piece sprites, cell 12 the dot */
+#define ATLAS_DIM 4
+#define ATLAS_PX (TILE_LEN * ATLAS_DIM)
+#define ATLAS_CACHE "assets/atlas.rgba"
+#define CELL_DOT 12
+
+// Exact x/255 for x < 255*256, matching _mm256_mulhi_epu16(x + 128, 257)
+#define DIV255(x) (((x) + 128 + (((x) + 128) >> 8)) >> 8)
+
+// Bitboards: bit n of a u64 is board square n
+#define FILE_A 0x0101010101010101ULL
+#define FILE_H 0x8080808080808080ULL
+
+/* View of a (8-byte aligned) board as eight rank-wide words, for
+   whole-board sweeps that touch one u64 per rank instead of 8 bytes
+   Going through the union keeps the punning legal under strict aliasing
+   instead of dereferencing a casted u64* directly */
+union BoardRanks { u8 sq[64]; u64 rank[8]; };
+#define RANKS(board) (((union BoardRanks*)(board))->rank)
+
 enum Pieces { NONE, PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING };
 enum Color  { WHITE, BLACK=8 };
 
-SDL_Texture* loadSVGFromFile(SDL_Renderer* renderer, const char* filename,
-                             int width, int height)
+/* Square byte tests (see bit layout above)
+   XORing two bytes and masking the color bit is one op instead of the
+   four shifts and compares of extracting each color separately */
+#define SAME_COLOR(a, b) ((((a) ^ (b)) & 8) == 0)
+#define IS_TOP(x)         ((x) & 16)
+#define HAS_NOT_MOVED(x)  ((x) & 16)
+#define CAN_EN_PASSANT(x) ((x) & 32)
+
+/* Branch hint for the move-generation hot paths: most squares a piece
+   can reach are empty, so lay out the dotting code for that case */
+#define LIKELY(x) __builtin_expect(!!(x), 1)
+
+/* Type-plus-flag tests as one masked compare instead of two extractions */
+#define IS_UNMOVED_ROOK(x) (((x) & 0x17) == (ROOK | 16))
+#define IS_EP_PAWN(x)      (((x) & 0x27) == (PAWN | 32))
+#define IS_DOTTED_KING(x)  (((x) & 0x47) == (KING | 64))
+
+// Rasterizes an SVG file into an RGBA32 surface
+SDL_Surface* loadSVGFromFile(const char* filename, int width, int height)
 {
     SDL_RWops* io = SDL_RWFromFile(filename, "r");
     if (io == NULL) {
@@ -39,29 +89,41 @@ SDL_Texture* loadSVGFromFile(SDL_Renderer* renderer, const char* filename,
         return NULL;
     }
 
-    SDL_Texture* tex = SDL_CreateTextureFromSurface(renderer, sur);
+    SDL_Surface* rgba = SDL_ConvertSurfaceFormat(sur, SDL_PIXELFORMAT_RGBA32, 0);
     SDL_FreeSurface(sur);
-    if (tex == NULL) {
-        SDL_Log("Error creating texture: %s\n", SDL_GetError());
+    if (rgba == NULL) {
+        SDL_Log("Error converting surface: %s\n", SDL_GetError());
         return NULL;
     }
 
-    return tex;
+    return rgba;
 }
 
-// Pass board byte and get texture offset
-u8 getTextureID(u8 tile)
+// Copies a surface into a tightly packed RGBA buffer
+void copySurface(SDL_Surface* sur, u8* dst, int dst_pitch)
 {
-    u8 p = tile & 7;
-    if ((tile >> 3) & 1)
-        return 5 + p; // Is black
-    return p - 1; // Is white
+    int row;
+
+    for (row = 0; row < sur->h; row++)
+        memcpy(dst + row * dst_pitch, (u8*)sur->pixels + row * sur->pitch,
+               sur->w * 4);
 }
 
-// Set board to initial state
+/* Atlas cell per piece byte, indexed by the low 4 bits (color | type)
+   One load replaces the old getTextureID branch on the color bit:
+   white pieces map to cells 0-5, black to 6-11 */
+const u8 tex_cell[16] = {
+    0, 0, 1, 2, 3, 4, 5, 0,    // White: PAWN..KING -> 0-5
+    0, 6, 7, 8, 9, 10, 11, 0,  // Black: PAWN..KING -> 6-11
+};
+
+/* Set board to initial state
+   Each rank is composed as one u64 and written with a single store */
 void setupBoard(u8* board, u8 white_on_top)
 {
-    u8 i, side1, side2, left_middle, right_middle;
+    u64* ranks = RANKS(board);
+    u64 back;
+    u8 side1, side2, left_middle, right_middle;
 
     // | 16 is for king and rooks that haven't moved
     if (white_on_top) {
@@ -76,88 +138,265 @@ void setupBoard(u8* board, u8 white_on_top)
         right_middle = KING | 16;
     }
 
-    board[0] = side1 | ROOK | 16;
-    board[1] = side1 | KNIGHT;
-    board[2] = side1 | BISHOP;
-    board[3] = side1 | left_middle;
-    board[4] = side1 | right_middle;
-    board[5] = side1 | BISHOP;
-    board[6] = side1 | KNIGHT;
-    board[7] = side1 | ROOK | 16;
-    for (i = 8; i < 16; i++)
-        board[i] = side1 | PAWN | 16; // | 16 is for top pawns
-    for (; i < 48; i++)
-        board[i] = NONE;
-    for (; i < 56; i++)
-        board[i] = side2 | PAWN;
-    board[56] = side2 | ROOK | 16;
-    board[57] = side2 | KNIGHT;
-    board[58] = side2 | BISHOP;
-    board[59] = side2 | left_middle;
-    board[60] = side2 | right_middle;
-    board[61] = side2 | BISHOP;
-    board[62] = side2 | KNIGHT;
-    board[63] = side2 | ROOK | 16;
+    // Colorless back rank; the side color is broadcast onto every byte
+    back = (u64)(ROOK | 16)
+         | ((u64)KNIGHT << 8)
+         | ((u64)BISHOP << 16)
+         | ((u64)left_middle << 24)
+         | ((u64)right_middle << 32)
+         | ((u64)BISHOP << 40)
+         | ((u64)KNIGHT << 48)
+         | ((u64)(ROOK | 16) << 56);
+
+    ranks[0] = back | side1 * 0x0101010101010101ULL;
+    ranks[1] = (u64)(side1 | PAWN | 16) * 0x0101010101010101ULL; // Top pawns
+    memset(&board[16], NONE, 32);
+    ranks[6] = (u64)(side2 | PAWN) * 0x0101010101010101ULL;
+    ranks[7] = back | side2 * 0x0101010101010101ULL;
 }
 
-u8 drawBoard(u8* board, SDL_Renderer* renderer, SDL_Texture** textures,
-             SDL_Texture* chessboard, SDL_Rect* tile)
+/* CPU compositing state: the whole 600x600 scene is small enough that
+   blending it in RAM and uploading one streaming texture per frame is
+   cheaper than a driver round-trip per sprite */
+u8* g_atlas_px; // Piece and dot sprites, ATLAS_PX x ATLAS_PX
+u8* g_bg_px;    // Prerendered chessboard background, window-sized
+u8* g_frame_px; // Scratch frame composited by drawBoard
+SDL_Texture* g_frame_tex; // Persistent streaming texture the frame goes to
+
+/* Loads the atlas pixels from the prerasterized cache file, skipping the
+   SVG parser and rasterizer entirely; returns NULL if no valid cache */
+u8* loadAtlasCache(void)
 {
-    // It is recommended to clear renderer before each frame drawing
-    if (SDL_RenderClear(renderer) != 0) {
-        SDL_Log("Error clearing renderer: %s\n", SDL_GetError());
-        return 1;
+    const int size = ATLAS_PX * ATLAS_PX * 4;
+
+    SDL_RWops* io = SDL_RWFromFile(ATLAS_CACHE, "rb");
+    if (io == NULL)
+        return NULL;
+
+    u8* pixels = malloc(size);
+    if (pixels == NULL) {
+        SDL_RWclose(io);
+        return NULL;
     }
 
-    // Draw chessboard
-    if (SDL_RenderCopy(renderer, chessboard, NULL, NULL) != 0) {
-        SDL_Log("Error drawing chessboard: %s\n", SDL_GetError());
-        return 1;
+    // Reject caches rasterized for a different window size
+    if ((SDL_RWsize(io) != size)
+        || (SDL_RWread(io, pixels, 1, size) != (size_t)size)) {
+        SDL_Log("Ignoring stale atlas cache\n");
+        free(pixels);
+        SDL_RWclose(io);
+        return NULL;
     }
+    SDL_RWclose(io);
 
-    // Draw pieces
+    return pixels;
+}
+
+// Saves the atlas pixels so later launches can skip rasterization
+void saveAtlasCache(const u8* pixels)
+{
+    const int size = ATLAS_PX * ATLAS_PX * 4;
+
+    SDL_RWops* io = SDL_RWFromFile(ATLAS_CACHE, "wb");
+    if (io != NULL) {
+        if (SDL_RWwrite(io, pixels, 1, size) != (size_t)size)
+            SDL_Log("Error writing atlas cache: %s\n", SDL_GetError());
+        SDL_RWclose(io);
+    }
+}
+
+// Rasterizes the piece and dot SVGs into the atlas pixel buffer
+u8* buildAtlas(const char* const* asset_names)
+{
     u8 i;
+
+    // calloc leaves the unused cells fully transparent
+    u8* pixels = calloc(ATLAS_PX * ATLAS_PX, 4);
+    if (pixels == NULL)
+        return NULL;
+
+    for (i = 0; i < TEXTURES_NUM; i++) {
+        SDL_Surface* sur = loadSVGFromFile(asset_names[i], TILE_LEN, TILE_LEN);
+        if (sur == NULL) {
+            free(pixels);
+            return NULL;
+        }
+        copySurface(sur, pixels + (((i >> 2) * ATLAS_PX + (i & 3))
+                                   * TILE_LEN) * 4, ATLAS_PX * 4);
+        SDL_FreeSurface(sur);
+    }
+
+    return pixels;
+}
+
+/* Blends n RGBA pixels of src over dst (straight alpha), scaling the
+   source alpha by alpha/255 first; dst stays opaque */
+void blendRow(u8* dst, const u8* src, int n, u8 alpha)
+{
+    int col = 0;
+
+#ifdef __AVX2__
+    /* Eight pixels per iteration: widen both rows to 16-bit lanes,
+       replicate each pixel's alpha across its channels, then
+       src*a + dst*(255-a) with the exact mulhi-by-257 divide by 255
+       unpack/pack pairs operate per 128-bit lane symmetrically, so
+       pixel order survives without any cross-lane permute */
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i div = _mm256_set1_epi16(257);
+    const __m256i full = _mm256_set1_epi16(255);
+    const __m256i amod = _mm256_set1_epi16(alpha);
+    const __m256i opaque = _mm256_set1_epi32((int)0xff000000);
+    __m256i out[2];
+
+    for (; col + 8 <= n; col += 8, src += 32, dst += 32) {
+        __m256i s = _mm256_loadu_si256((const __m256i*)src);
+        __m256i d = _mm256_loadu_si256((const __m256i*)dst);
+        u8 h;
+
+        for (h = 0; h < 2; h++) {
+            __m256i sv = h ? _mm256_unpackhi_epi8(s, zero)
+                           : _mm256_unpacklo_epi8(s, zero);
+            __m256i dv = h ? _mm256_unpackhi_epi8(d, zero)
+                           : _mm256_unpacklo_epi8(d, zero);
+            __m256i a = _mm256_shufflehi_epi16(
+                            _mm256_shufflelo_epi16(sv, 0xff), 0xff);
+            __m256i x;
+
+            a = _mm256_mulhi_epu16(
+                    _mm256_add_epi16(_mm256_mullo_epi16(a, amod), bias), div);
+            x = _mm256_add_epi16(
+                    _mm256_mullo_epi16(sv, a),
+                    _mm256_mullo_epi16(dv, _mm256_sub_epi16(full, a)));
+            out[h] = _mm256_mulhi_epu16(_mm256_add_epi16(x, bias), div);
+        }
+
+        _mm256_storeu_si256((__m256i*)dst,
+            _mm256_or_si256(_mm256_packus_epi16(out[0], out[1]), opaque));
+    }
+#endif
+
+    for (; col < n; col++, src += 4, dst += 4) {
+        unsigned a = DIV255(src[3] * alpha);
+
+        dst[0] = (u8)DIV255(src[0] * a + dst[0] * (255 - a));
+        dst[1] = (u8)DIV255(src[1] * a + dst[1] * (255 - a));
+        dst[2] = (u8)DIV255(src[2] * a + dst[2] * (255 - a));
+        dst[3] = 255;
+    }
+}
+
+// Alpha-blits one atlas cell onto the frame at pixel position x, y
+void blendCell(int x, int y, u8 cell, u8 alpha)
+{
+    int row;
+
+    for (row = 0; row < TILE_LEN; row++)
+        blendRow(g_frame_px + (((y + row) * WIN_WIDTH + x) << 2),
+                 g_atlas_px + ((((cell >> 2) * TILE_LEN + row) * ATLAS_PX
+                                + (cell & 3) * TILE_LEN) << 2),
+                 TILE_LEN, alpha);
+}
+
+// Overwrites one tile of the frame with a solid opaque color
+void fillTile(int x, int y, u8 r, u8 g, u8 b)
+{
+    int row, col;
+
+    for (row = 0; row < TILE_LEN; row++) {
+        u8* d = g_frame_px + (((y + row) * WIN_WIDTH + x) << 2);
+
+        for (col = 0; col < TILE_LEN; col++, d += 4) {
+            d[0] = r;
+            d[1] = g;
+            d[2] = b;
+            d[3] = 255;
+        }
+    }
+}
+
+u8 drawBoard(u8* board, SDL_Renderer* renderer)
+{
+    /* Snapshot of the last board drawn
+       Piece type 7 does not exist, so the first draw always runs even
+       for a fully empty board (a piece-free FEN is accepted) */
+    static _Alignas(64) u8 prev_board[64] = { 7 };
+
+    u8 i;
+
+    // Skip the frame entirely if nothing visible changed since last draw
+    {
+        u64* b = RANKS(board);
+        u64* p = RANKS(prev_board);
+        u64 diff = 0;
+
+        for (i = 0; i < 8; i++)
+            diff |= b[i] ^ p[i];
+        if (diff == 0)
+            return 0;
+    }
+    memcpy(prev_board, board, 64);
+
+    // Start from the prerendered chessboard background
+    memcpy(g_frame_px, g_bg_px, WIN_WIDTH * WIN_HEIGHT * 4);
+
+    // Composite pieces and dots over it in RAM
     for (i = 0; i < 64; i++) {
-        tile->x = (i & 7) * TILE_LEN;
-        tile->y = (i >> 3) * TILE_LEN;
+        int x = (i & 7) * TILE_LEN;
+        int y = (i >> 3) * TILE_LEN;
 
         // Check if there is piece on tile
         if (board[i] & 7) {
 
             // Check if selected
-            if (board[i] >> 7) {
-                if (SDL_RenderFillRect(renderer, tile) != 0) {
-                    SDL_Log("Error drawing select square: %s\n", SDL_GetError());
-                    return 1;
-                }
-            }
+            if (board[i] >> 7)
+                fillTile(x, y, 255, 255, 0); // Tile highlight color
 
             // Draw piece
-            if (SDL_RenderCopy(renderer, textures[getTextureID(board[i])], NULL, tile) != 0) {
-                SDL_Log("Error drawing piece: %s\n", SDL_GetError());
-                return 1;
-            }
+            blendCell(x, y, tex_cell[board[i] & 15], 255);
         }
 
         // Draw dot if exists
-        if ((board[i] >> 6) & 1) {
-            if (SDL_RenderCopy(renderer, textures[12], NULL, tile) != 0) {
-                SDL_Log("Error drawing dot: %s\n", SDL_GetError());
-                return 1;
-            }
-        }
+        if ((board[i] >> 6) & 1)
+            blendCell(x, y, CELL_DOT, 63); // 25% opacity
+    }
+
+    // One upload and one copy replace a render command per sprite
+    if ((SDL_UpdateTexture(g_frame_tex, NULL, g_frame_px, WIN_WIDTH * 4) != 0)
+        || (SDL_RenderCopy(renderer, g_frame_tex, NULL, NULL) != 0)) {
+        SDL_Log("Error presenting frame: %s\n", SDL_GetError());
+        return 1;
     }
 
     SDL_RenderPresent(renderer);
     return 0;
 }
 
+/* ANDs every square of the board with a mask
+   The board is exactly two 256-bit registers, so clear whole-board bits
+   with vector ANDs instead of 64 scalar read-modify-writes
+   Boards passed here must be 32-byte aligned */
+void andBoard(u8* board, u8 mask)
+{
+#ifdef __AVX2__
+    __m256i m = _mm256_set1_epi8((char)mask);
+    _mm256_store_si256((__m256i*)board,
+        _mm256_and_si256(_mm256_load_si256((__m256i*)board), m));
+    _mm256_store_si256((__m256i*)(board + 32),
+        _mm256_and_si256(_mm256_load_si256((__m256i*)(board + 32)), m));
+#else
+    u64* ranks = RANKS(board);
+    u64 m = mask * 0x0101010101010101ULL;
+    u8 i;
+    for (i = 0; i < 8; i++)
+        ranks[i] &= m;
+#endif
+}
+
 // Removes all dots from board
 void removeDots(u8* board)
 {
-    u8 i;
-    for (i = 0; i < 64; i++)
-        board[i] &= 0xbf;
+    andBoard(board, 0xbf);
 }
 
 /* Returns whether target square was dotted
@@ -166,42 +405,309 @@ void removeDots(u8* board)
    2 = Occupied square dotted */
 u8 dotSquare(u8* board, u8 pos, u8 n)
 {
-    if ((board[n] & 7) == NONE) {
+    if (LIKELY((board[n] & 7) == NONE)) {
         board[n] |= 64;
         return 1;
     }
-    if (((board[pos] >> 3) & 1) != ((board[n] >> 3) & 1)) {
+    if (!SAME_COLOR(board[pos], board[n])) {
         board[n] |= 64;
         return 2;
     }
     return 0;
 }
 
+/* One-square bitboard shifts, named by index delta
+   The file masks stop pieces wrapping between ranks */
+u64 shiftP9(u64 b) { return (b & ~FILE_H) << 9; }
+u64 shiftP7(u64 b) { return (b & ~FILE_A) << 7; }
+u64 shiftM9(u64 b) { return (b & ~FILE_A) >> 9; }
+u64 shiftM7(u64 b) { return (b & ~FILE_H) >> 7; }
+u64 shiftP8(u64 b) { return b << 8; }
+u64 shiftM8(u64 b) { return b >> 8; }
+u64 shiftP1(u64 b) { return (b & ~FILE_H) << 1; }
+u64 shiftM1(u64 b) { return (b & ~FILE_A) >> 1; }
+
+// Squares a slider attacks in one direction, up to and including first blocker
+u64 rayAttacks(u64 piece, u64 empty, u64 (*shift)(u64))
+{
+    u64 flood = 0, g = shift(piece);
+
+    while (g) {
+        flood |= g;
+        g = shift(g & empty);
+    }
+    return flood;
+}
+
+u64 knight_attacks[64], king_attacks[64];
+
+/* Per-square line masks (square itself excluded) and the first-rank
+   attack table, for branchless sliding attacks */
+u64 mask_diag[64], mask_adiag[64], mask_file[64];
+u8 first_rank_attacks[64][8];
+
+// Fills the attack and line-mask tables; call once at startup
+void initAttackTables(void)
+{
+    u8 i, f;
+
+    for (i = 0; i < 64; i++) {
+        u64 b = 1ULL << i;
+        knight_attacks[i] = shiftP8(shiftP9(b)) | shiftP8(shiftP7(b))
+                          | shiftP1(shiftP9(b)) | shiftM1(shiftP7(b))
+                          | shiftM8(shiftM9(b)) | shiftM8(shiftM7(b))
+                          | shiftM1(shiftM9(b)) | shiftP1(shiftM7(b));
+        king_attacks[i] = shiftP9(b) | shiftP8(b) | shiftP7(b) | shiftP1(b)
+                        | shiftM1(b) | shiftM7(b) | shiftM8(b) | shiftM9(b);
+        mask_diag[i] = rayAttacks(b, ~0ULL, shiftP9)
+                     | rayAttacks(b, ~0ULL, shiftM9);
+        mask_adiag[i] = rayAttacks(b, ~0ULL, shiftP7)
+                      | rayAttacks(b, ~0ULL, shiftM7);
+        mask_file[i] = rayAttacks(b, ~0ULL, shiftP8)
+                     | rayAttacks(b, ~0ULL, shiftM8);
+    }
+
+    /* Rook attacks within one rank, indexed by the rank's middle six
+       occupancy bits (edge squares never block anything beyond them) */
+    for (i = 0; i < 64; i++) {
+        u8 occ = i << 1;
+        for (f = 0; f < 8; f++) {
+            u8 att = 0, sq;
+            for (sq = f + 1; sq < 8; sq++) {
+                att |= 1 << sq;
+                if (occ & (1 << sq)) break;
+            }
+            for (sq = f; sq > 0; sq--) {
+                att |= 1 << (sq - 1);
+                if (occ & (1 << (sq - 1))) break;
+            }
+            first_rank_attacks[i][f] = att;
+        }
+    }
+}
+
+/* Sliding attacks along one masked line via the o^(o-2r) trick, run
+   once forward and once on the byte-reversed board so blockers are
+   found on both sides of the piece */
+u64 lineAttacks(u64 occ, u64 piece, u64 mask)
+{
+    u64 fwd = occ & mask;
+    u64 rev = __builtin_bswap64(fwd);
+
+    fwd -= 2 * piece;
+    rev -= 2 * __builtin_bswap64(piece);
+    return (fwd ^ __builtin_bswap64(rev)) & mask;
+}
+
+// Rank attacks come from the table since bswap cannot reverse one rank
+u64 rankAttacks(u64 occ, u8 i)
+{
+    u8 base = i & 56;
+    u8 o = ((occ >> base) >> 1) & 63;
+
+    return (u64)first_rank_attacks[o][i & 7] << base;
+}
+
+/* Zobrist keys: one per square and piece byte (low 6 bits: type, color,
+   moved/top and en passant flags), plus keys for the candidate move and
+   side to move so legality lookups are position-exact */
+u64 zobrist[64][64];
+u64 zob_from[64], zob_to[64], zob_turn;
+
+// Transposition table caching verifyMove results, direct-mapped
+struct TTEntry { u64 key; u8 legal; };
+struct TTEntry tt[1 << 16];
+
+// splitmix64, good enough to fill the Zobrist tables
+u64 nextRandom(u64* state)
+{
+    u64 z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Fills the Zobrist key tables; call once at startup
+void initZobrist(void)
+{
+    u64 state = 0x2545f4914f6cdd1dULL;
+    u8 i, j;
+
+    for (i = 0; i < 64; i++) {
+        for (j = 0; j < 64; j++)
+            zobrist[i][j] = nextRandom(&state);
+        zob_from[i] = nextRandom(&state);
+        zob_to[i] = nextRandom(&state);
+    }
+    zob_turn = nextRandom(&state);
+}
+
+/* Builds occupancy bitboards from the mailbox board, one rank at a time
+   own gets the pieces of the same color as board[i]
+   A byte holds a piece if its low 3 bits are nonzero: adding 0x7f
+   carries into bit 7 exactly for those bytes, and the multiply packs
+   the resulting per-byte flags into one occupancy byte per rank */
+void buildOccupancy(u8* board, u8 i, u64* occ, u64* own)
+{
+    u64* ranks = RANKS(board);
+    u64 color = (u64)(board[i] & 8) * 0x0101010101010101ULL;
+    u8 r;
+
+    *occ = 0;
+    *own = 0;
+    for (r = 0; r < 8; r++) {
+        u64 b = ranks[r];
+        u64 pres = (((b & 0x0707070707070707ULL) + 0x7f7f7f7f7f7f7f7fULL)
+                    >> 7) & 0x0101010101010101ULL;
+        u64 mine = pres & ~((b ^ color) >> 3) & 0x0101010101010101ULL;
+        *occ |= ((pres * 0x0102040810204080ULL) >> 56) << (r * 8);
+        *own |= ((mine * 0x0102040810204080ULL) >> 56) << (r * 8);
+    }
+}
+
+// Dots every square set in the mask
+void dotMask(u8* board, u64 mask)
+{
+    while (mask) {
+        board[__builtin_ctzll(mask)] |= 64;
+        mask &= mask - 1;
+    }
+}
+
 void dotDiagonals(u8* board, u8 i)
 {
-    u8 j;
-    for (j = i - 9; (j < 64) && ((j & 7) != 7); j -= 9)
-        if (dotSquare(board, i, j) != 1) break;
-    for (j = i - 7; (j < 64) && ((j & 7) != 0); j -= 7)
-        if (dotSquare(board, i, j) != 1) break;
-    for (j = i + 7; (j < 64) && ((j & 7) != 7); j += 7)
-        if (dotSquare(board, i, j) != 1) break;
-    for (j = i + 9; (j < 64) && ((j & 7) != 0); j += 9)
-        if (dotSquare(board, i, j) != 1) break;
+    u64 occ, own, piece;
+
+    buildOccupancy(board, i, &occ, &own);
+    piece = 1ULL << i;
+    dotMask(board, (lineAttacks(occ, piece, mask_diag[i])
+                  | lineAttacks(occ, piece, mask_adiag[i])) & ~own);
+}
+
+/* Index of the currently selected square, 0xff if none
+   Saves rescanning the board for the MSB when a move is committed */
+u8 g_selected = 0xff;
+
+/* Square of the pawn that can be "en passanted" this turn, 0xff if none
+   Only one pawn per turn can double-push, so a single index suffices */
+u8 g_ep = 0xff;
+
+/* Compiled-in test positions, selectable by name on the command line
+   (kiwipete and endgame are the standard perft suite positions) */
+struct Preset { const char* name; const char* fen; };
+const struct Preset presets[] = {
+    { "startpos", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1" },
+    { "kiwipete",
+      "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1" },
+    { "endgame", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1" },
+};
+
+/* Loads a position from a FEN string, white on the bottom
+   Reads the placement, side, castling and en passant fields
+   Returns the side to move (1 = white) or 0xff on malformed input */
+u8 parseFEN(const char* fen, u8* board)
+{
+    const char* p = fen;
+    u8 i = 0, turn = 1, type;
+
+    g_ep = 0xff;
+
+    // Piece placement, rank 8 (board row 0) first, just like the board
+    while (*p && (*p != ' ')) {
+        char c = *p++;
+
+        if (c == '/')
+            continue;
+        if ((c >= '1') && (c <= '8')) {
+            u8 n = c - '0';
+            if (i + n > 64)
+                return 0xff;
+            while (n--)
+                board[i++] = NONE;
+            continue;
+        }
+        switch (c | 32) {
+        case 'p': type = PAWN; break;
+        case 'n': type = KNIGHT; break;
+        case 'b': type = BISHOP; break;
+        case 'r': type = ROOK; break;
+        case 'q': type = QUEEN; break;
+        case 'k': type = KING; break;
+        default: return 0xff;
+        }
+        if (i >= 64)
+            return 0xff;
+        // Lowercase (bit 32 in ASCII) is black; black pawns are top pawns
+        board[i] = (c & 32) ? (BLACK | type | ((type == PAWN) ? 16 : 0))
+                            : (WHITE | type);
+        i++;
+    }
+    if (i != 64)
+        return 0xff;
+
+    // Side to move
+    if (*p == ' ')
+        p++;
+    if (*p == 'w') {
+        turn = 1;
+        p++;
+    } else if (*p == 'b') {
+        turn = 0;
+        p++;
+    }
+
+    // Castling rights become the unmoved bits on king and rook squares
+    if (*p == ' ')
+        p++;
+    while (*p && (*p != ' ')) {
+        u8 ksq = 60, rsq = 0xff, color = WHITE;
+
+        switch (*p) {
+        case 'K': rsq = 63; break;
+        case 'Q': rsq = 56; break;
+        case 'k': rsq = 7; ksq = 4; color = BLACK; break;
+        case 'q': rsq = 0; ksq = 4; color = BLACK; break;
+        }
+        if ((rsq != 0xff) && ((board[rsq] & 15) == (color | ROOK))
+            && ((board[ksq] & 15) == (color | KING))) {
+            board[rsq] |= 16;
+            board[ksq] |= 16;
+        }
+        p++;
+    }
+
+    // En passant target square names the pawn that just double-pushed
+    if (*p == ' ')
+        p++;
+    if ((*p >= 'a') && (*p <= 'h') && (p[1] >= '1') && (p[1] <= '8')) {
+        u8 row = '8' - p[1]; // FEN rank 8 is board row 0
+        u8 sq = 0xff;
+
+        if (row == 2)
+            sq = (row + 1) * 8 + (*p - 'a'); // Black pawn below the target
+        else if (row == 5)
+            sq = (row - 1) * 8 + (*p - 'a'); // White pawn above the target
+        if ((sq != 0xff) && ((board[sq] & 7) == PAWN)) {
+            board[sq] |= 32;
+            g_ep = sq;
+        }
+    }
+
+    return turn;
 }
 
 /* Moves piece on a board
-   i is where piece moved */
-void movePiece(u8* board, u8 i)
+   from is the selected square, i is where piece moved */
+void movePiece(u8* board, u8 from, u8 i)
 {
-    u8 j;
+    u8 j = from;
 
-    // Each turn turn off en passant bit for pawns
-    for (j = 0; j < 64; j++)
-        board[j] &= 0xdf;
+    // Each turn turn off en passant bit for last turn's double-pushed pawn
+    if (g_ep != 0xff) {
+        board[g_ep] &= 0xdf;
+        g_ep = 0xff;
+    }
 
-    // Get index of selected piece
-    for (j = 0; (board[j] >> 7) == 0; j++);
     removeDots(board);
 
     switch (board[j] & 7) {
@@ -223,8 +729,10 @@ void movePiece(u8* board, u8 i)
             // Move selected piece on new square
             board[i] = board[j] & 31;
             // Record that pawn moved 2 squares (for en passant)
-            if (((i-j) == 16) || ((j-i) == 16))
+            if (((i-j) == 16) || ((j-i) == 16)) {
                  board[i] |= 32;
+                 g_ep = i;
+            }
         }
         break;
     case KING:
@@ -254,124 +762,82 @@ void movePiece(u8* board, u8 i)
 // Calculates dots for a piece
 void calculateMoves(u8* board, u8 i)
 {
-    u8 j;
-
     switch (board[i] & 7) {
-    case PAWN:
-        if ((board[i] >> 4) & 1) {
-        // Top pawn
-        // Two squares forward
-        if ((i < 16) && ((board[i+16] & 7) == NONE))
-            board[i+16] |= 64;
+    case PAWN: {
+        /* Top and bottom pawns run the same logic with the walk
+           direction flipped, so drive it with a signed offset instead
+           of duplicating every branch per side */
+        int dir = IS_TOP(board[i]) ? 8 : -8;
+        int fwd = i + dir;
+        int s;
+
+        // Two squares forward (from the starting rank only)
+        if ((IS_TOP(board[i]) ? (i < 16) : (i >= 48))
+            && LIKELY((board[i + 2*dir] & 7) == NONE))
+            board[i + 2*dir] |= 64;
+
         // One square forward
-        if ((i < 56) && ((board[i+8] & 7) == NONE))
-            board[i+8] |= 64;
-        // Capture on right
-        if ((i < 55) && ((i & 7) != 7) && (((board[i+9] & 7) &&
-            (((board[i+9] >> 3) & 1) != ((board[i] >> 3) & 1)))
-            // En passant on right
-            || (((board[i+1] & 7) == PAWN) && ((board[i+1] >> 5) & 1)
-            && (((board[i+1] >> 3) & 1) != ((board[i] >> 3) & 1)))))
-            board[i+9] |= 64;
-        // Capture on left
-        if ((i < 57) && (i & 7) && (((board[i+7] & 7) &&
-            (((board[i+7] >> 3) & 1) != ((board[i] >> 3) & 1)))
-            // En passant on left
-            || (((board[i-1] & 7) == PAWN) && ((board[i-1] >> 5) & 1)
-            && (((board[i-1] >> 3) & 1) != ((board[i] >> 3) & 1)))))
-            board[i+7] |= 64;
-        } else {
-            // Bottom pawn
-            // Two squares forward
-            if ((i >= 48) && ((board[i-16] & 7) == NONE))
-                board[i-16] |= 64;
-            // One square forward
-            if ((i >= 8) && ((board[i-8] & 7) == NONE))
-                board[i-8] |= 64;
-            // Capture on left
-            if ((i >= 9) && (i & 7) && (((board[i-9] & 7) &&
-                (((board[i-9] >> 3) & 1) != ((board[i] >> 3) & 1)))
-                // En passant on left
-                || (((board[i-1] & 7) == PAWN) && ((board[i-1] >> 5) & 1)
-                && (((board[i-1] >> 3) & 1) != ((board[i] >> 3) & 1)))))
-                board[i-9] |= 64;
-            // Capture on right
-            if ((i > 7) && ((i & 7) != 7) && (((board[i-7] & 7) &&
-                (((board[i-7] >> 3) & 1) != ((board[i] >> 3) & 1)))
-                // En passant on right
-                || (((board[i+1] & 7) == PAWN) && ((board[i+1] >> 5) & 1)
-                && (((board[i+1] >> 3) & 1) != ((board[i] >> 3) & 1)))))
-                board[i-7] |= 64;
+        if ((fwd >= 0) && (fwd < 64) && LIKELY((board[fwd] & 7) == NONE))
+            board[fwd] |= 64;
+
+        // Capture and en passant, one file to each side
+        for (s = -1; s <= 1; s += 2) {
+            int t = fwd + s;
+
+            // No captures off the edge of the board
+            if ((s < 0) ? ((i & 7) == 0) : ((i & 7) == 7))
+                continue;
+            if ((t >= 0) && (t < 64) && (((board[t] & 7) &&
+                !SAME_COLOR(board[t], board[i]))
+                || (IS_EP_PAWN(board[i+s])
+                && !SAME_COLOR(board[i+s], board[i]))))
+                board[t] |= 64;
         }
         break;
-    case KNIGHT:
-        if ((i >= 17) && (i & 7))
-            dotSquare(board, i, i-17);
-        if ((i >= 15) && ((i & 7) != 7))
-            dotSquare(board, i, i-15);
-        if ((i >= 10) && ((i & 7) > 1))
-            dotSquare(board, i, i-10);
-        if ((i >= 6) && ((i & 7) < 6))
-            dotSquare(board, i, i-6);
-        if ((i < 47) && (i & 7) != 7)
-            dotSquare(board, i, i+17);
-        if ((i < 49) && (i & 7))
-            dotSquare(board, i, i+15);
-        if ((i < 54) && ((i & 7) < 6))
-            dotSquare(board, i, i+10);
-        if ((i < 58) && ((i & 7) > 1))
-            dotSquare(board, i, i+6);
+    }
+    case KNIGHT: {
+        u64 occ, own;
+
+        buildOccupancy(board, i, &occ, &own);
+        dotMask(board, knight_attacks[i] & ~own);
         break;
+    }
     case BISHOP:
         dotDiagonals(board, i);
         break;
     case QUEEN:
         dotDiagonals(board, i);
-    case ROOK:
-        for (j = i - 8; j < 64; j -= 8)
-            if (dotSquare(board, i, j) != 1) break;
-        for (j = i - 1; (j & 7) != 7; j--)
-            if (dotSquare(board, i, j) != 1) break;
-        for (j = i + 1; (j & 7) != 0; j++)
-            if (dotSquare(board, i, j) != 1) break;
-        for (j = i + 8; j < 64; j += 8)
-            if (dotSquare(board, i, j) != 1) break;
+    case ROOK: {
+        u64 occ, own;
+
+        buildOccupancy(board, i, &occ, &own);
+        dotMask(board, (lineAttacks(occ, 1ULL << i, mask_file[i])
+                      | rankAttacks(occ, i)) & ~own);
         break;
-    case KING:
-        if (i >= 8)
-            dotSquare(board, i, i-8);
-        if (i & 7)
-            dotSquare(board, i, i-1);
-        if ((i & 7) != 7)
-            dotSquare(board, i, i+1);
-        if (i < 56)
-            dotSquare(board, i, i+8);
-        if ((i >= 9) && (i & 7))
-            dotSquare(board, i, i-9);
-        if ((i > 7) && ((i & 7) != 7))
-            dotSquare(board, i, i-7);
-        if ((i < 57) && (i & 7))
-            dotSquare(board, i, i+7);
-        if ((i < 55) && ((i & 7) != 7))
-            dotSquare(board, i, i+9);
+    }
+    case KING: {
+        u64 occ, own;
+
+        buildOccupancy(board, i, &occ, &own);
+        dotMask(board, king_attacks[i] & ~own);
 
         // Castling
-        if ((board[i] >> 4) & 1) {
+        if (HAS_NOT_MOVED(board[i])) {
             if ((i & 7) == 3) {
                 // King on left
-                if (((board[i-3] & 7) == ROOK) && ((board[i-3] >> 4) & 1)
+                if (IS_UNMOVED_ROOK(board[i-3])
                     && ((board[i-2] & 7) == NONE) && ((board[i-1] & 7) == NONE))
                     dotSquare(board, i, i-2);
-                if (((board[i+4] & 7) == ROOK) && ((board[i+4] >> 4) & 1)
+                if (IS_UNMOVED_ROOK(board[i+4])
                     && ((board[i+1] & 7) == NONE) && ((board[i+2] & 7) == NONE)
                     && ((board[i+3] & 7) == NONE))
                     dotSquare(board, i, i+2);
             } else {
                 // King on right
-                if (((board[i+3] & 7) == ROOK) && ((board[i+3] >> 4) & 1)
+                if (IS_UNMOVED_ROOK(board[i+3])
                     && ((board[i+2] & 7) == NONE) && ((board[i+1] & 7) == NONE))
                     dotSquare(board, i, i+2);
-                if (((board[i-4] & 7) == ROOK) && ((board[i-4] >> 4) & 1)
+                if (IS_UNMOVED_ROOK(board[i-4])
                     && ((board[i-1] & 7) == NONE) && ((board[i-2] & 7) == NONE)
                     && ((board[i-3] & 7) == NONE))
                     dotSquare(board, i, i-2);
@@ -379,20 +845,57 @@ void calculateMoves(u8* board, u8 i)
         }
         break;
     }
+    }
 }
 
 // next_sides_turn: 1 = white, 0 = black
 u8 verifyMove(u8* board, u8 i, u8 next_sides_turn)
 {
-    u8 board2[64];
-    u8 j;
+    /* Scratch copy reused across calls (verifyMove never recurses), so
+       each legality check skips setting up a fresh stack buffer and the
+       copy target stays hot in L1 at a fixed address */
+    static _Alignas(64) u8 board2[64];
+    u8 j, saved_ep;
+    u64 h;
+    struct TTEntry* entry;
 
-    // Make copy of board
+    /* Hash the position (dot and select bits excluded) together with the
+       candidate move and side, and reuse a cached legality verdict if the
+       exact same check was done before */
+    h = next_sides_turn ? zob_turn : 0;
     for (j = 0; j < 64; j++)
-        board2[j] = board[j];
+        h ^= zobrist[j][board[j] & 0x3f];
+    h ^= zob_from[g_selected] ^ zob_to[i];
+
+    entry = &tt[h & 0xffff];
+    if (entry->key == h)
+        return entry->legal;
+    entry->key = h;
+    entry->legal = 1;
 
-    // Simulate if move is played
-    movePiece(board2, i);
+    // Make copy of board; fixed 64-byte size compiles to two vector moves
+    memcpy(board2, board, 64);
+
+    /* Simulate if move is played
+       The simulation must not disturb the real board's en passant cache */
+    saved_ep = g_ep;
+    movePiece(board2, g_selected, i);
+    g_ep = saved_ep;
+
+    /* Find the moving side's king once; only a dot landing on that one
+       square can make the move illegal (enemy pieces never dot their
+       own king), so there is no need to rescan or clear the board
+       between enemy pieces - calculateMoves never reads dot bits */
+    u8 king_sq = 0xff;
+    u8 king = KING | (next_sides_turn ? WHITE : BLACK);
+    for (j = 0; j < 64; j++) {
+        if ((board2[j] & 15) == king) {
+            king_sq = j;
+            break;
+        }
+    }
+    if (king_sq == 0xff)
+        return 1;
 
     // Search board for opposite player's pieces
     for (j = 0; j < 64; j++) {
@@ -400,17 +903,103 @@ u8 verifyMove(u8* board, u8 i, u8 next_sides_turn)
             (((board2[j] >> 3) & 1) == next_sides_turn)) {
             // See if player can take king on next turn
             calculateMoves(board2, j);
-            for (i = 0; i < 64; i++) {
-                if (((board2[i] >> 6) & 1) && ((board2[i] & 7) == KING))
-                    return 0;
+            if (IS_DOTTED_KING(board2[king_sq])) {
+                entry->legal = 0;
+                return 0;
             }
-            removeDots(board2);
         }
     }
 
     return 1;
 }
 
+/* Returns whether the selected piece's dots must go through verifyMove
+   Only the king itself, a pinned piece, any move while in check, or an
+   en passant capture (which empties two squares of a rank at once) can
+   expose the king; for everything else the dots are legal as generated */
+u8 moveNeedsVerify(u8* board, u8 i)
+{
+    u64 occ, own, kbb, piece, a;
+    u64 knights = 0, pawns_top = 0, pawns_bottom = 0;
+    u64 diag_sliders = 0, line_sliders = 0;
+    u8 king_sq, j, t;
+
+    if ((board[i] & 7) == KING)
+        return 1;
+
+    // En passant capture: a dotted diagonal onto an empty square
+    if ((board[i] & 7) == PAWN) {
+        int fwd = i + (IS_TOP(board[i]) ? 8 : -8);
+        int s;
+        for (s = -1; s <= 1; s += 2) {
+            int cap = fwd + s;
+            if ((cap >= 0) && (cap < 64) && ((board[cap] & 0x47) == 64))
+                return 1;
+        }
+    }
+
+    // Find our king and sort the enemy pieces into attack classes
+    king_sq = 0xff;
+    for (j = 0; j < 64; j++) {
+        t = board[j] & 7;
+        if (t == NONE)
+            continue;
+        if (SAME_COLOR(board[j], board[i])) {
+            if (t == KING)
+                king_sq = j;
+            continue;
+        }
+        if ((t == BISHOP) || (t == QUEEN))
+            diag_sliders |= 1ULL << j;
+        if ((t == ROOK) || (t == QUEEN))
+            line_sliders |= 1ULL << j;
+        if (t == KNIGHT)
+            knights |= 1ULL << j;
+        if (t == PAWN) {
+            if (IS_TOP(board[j]))
+                pawns_top |= 1ULL << j;
+            else
+                pawns_bottom |= 1ULL << j;
+        }
+    }
+    if (king_sq == 0xff)
+        return 1;
+
+    // Knight or pawn giving check
+    kbb = 1ULL << king_sq;
+    if (knights & knight_attacks[king_sq])
+        return 1;
+    if ((shiftP7(pawns_top) | shiftP9(pawns_top)
+       | shiftM7(pawns_bottom) | shiftM9(pawns_bottom)) & kbb)
+        return 1;
+
+    /* Slider checks and pins: walk the four lines through the king; a
+       slider on the first-blocker set is a check, and if the selected
+       piece is a first blocker, lift it and look again for a pin */
+    buildOccupancy(board, i, &occ, &own);
+    piece = 1ULL << i;
+    for (j = 0; j < 4; j++) {
+        u64 mask, sliders;
+
+        switch (j) {
+        case 0: mask = mask_diag[king_sq]; sliders = diag_sliders; break;
+        case 1: mask = mask_adiag[king_sq]; sliders = diag_sliders; break;
+        case 2: mask = mask_file[king_sq]; sliders = line_sliders; break;
+        default: mask = ~0ULL; sliders = line_sliders; break;
+        }
+        a = (j == 3) ? rankAttacks(occ, king_sq)
+                     : lineAttacks(occ, kbb, mask);
+        if (a & sliders)
+            return 1;
+        if ((a & piece) && (((j == 3)
+                ? rankAttacks(occ & ~piece, king_sq)
+                : lineAttacks(occ & ~piece, kbb, mask)) & sliders))
+            return 1;
+    }
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     const char* asset_names[] = { 
@@ -429,6 +1018,9 @@ int main(int argc, char *argv[])
         "assets/dot.svg"
     };
 
+    initAttackTables();
+    initZobrist();
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         SDL_Log("Error initializing SDL: %s\n", SDL_GetError());
         return 1;
@@ -450,64 +1042,86 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Load textures
-    SDL_Texture* textures[TEXTURES_NUM];
+    /* Use the prerasterized atlas cache when present; otherwise rasterize
+       the sprite SVGs into it once and leave a cache behind for the next
+       launch; drawBoard composites from these pixels on the CPU */
     u8 i;
-    for (i = 0; i < TEXTURES_NUM; i++) {
-        textures[i] = loadSVGFromFile(renderer, asset_names[i], TILE_LEN, TILE_LEN);
-        if (textures[i] == NULL) {
-            SDL_Log("Error loading textures: %s\n", SDL_GetError());
+    g_atlas_px = loadAtlasCache();
+    if (g_atlas_px == NULL) {
+        g_atlas_px = buildAtlas(asset_names);
+        if (g_atlas_px == NULL) {
             SDL_DestroyRenderer(renderer);
             SDL_DestroyWindow(window);
             SDL_Quit();
             return 1;
         }
+        saveAtlasCache(g_atlas_px);
     }
 
-    // Make dot transparent (25% opacity)
-    if (SDL_SetTextureAlphaMod(textures[12], 63) != 0) {
-        SDL_Log("Error setting alpha mod: %s\n", SDL_GetError());
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        SDL_Quit();
-        return 1;
-    }
-
-    SDL_Texture* chessboard = loadSVGFromFile(renderer, "assets/chessboard.svg",
+    // Chessboard background pixels, blitted under every frame
+    SDL_Surface* chessboard = loadSVGFromFile("assets/chessboard.svg",
                                               WIN_WIDTH, WIN_HEIGHT);
-    if (chessboard == NULL) {
-        SDL_Log("Error loading textures: %s\n", SDL_GetError());
+    g_bg_px = malloc(WIN_WIDTH * WIN_HEIGHT * 4);
+    g_frame_px = malloc(WIN_WIDTH * WIN_HEIGHT * 4);
+    if ((chessboard == NULL) || (g_bg_px == NULL) || (g_frame_px == NULL)) {
+        SDL_Log("Error loading chessboard: %s\n", SDL_GetError());
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
         return 1;
     }
+    copySurface(chessboard, g_bg_px, WIN_WIDTH * 4);
+    SDL_FreeSurface(chessboard);
 
-    // Set to tile highlight color
-    if (SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255) != 0) {
-        SDL_Log("Error setting draw color: %s\n", SDL_GetError());
+    // The one texture frames are streamed into
+    g_frame_tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
+                                    SDL_TEXTUREACCESS_STREAMING,
+                                    WIN_WIDTH, WIN_HEIGHT);
+    if (g_frame_tex == NULL) {
+        SDL_Log("Error creating frame texture: %s\n", SDL_GetError());
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
         return 1;
     }
 
-    u8 board[64];
-    // If 'b' is passed as first arg, put black on bottom
-    setupBoard(board, (argc > 1) && ((argv[1][0] | 32) == 'b'));
+    _Alignas(64) u8 board[64];
+    u8 is_whites_turn = 1, loaded = 0;
 
-    SDL_Rect tile;
-    tile.w = TILE_LEN;
-    tile.h = TILE_LEN;
+    /* First arg may be a FEN string or a preset name to start from an
+       arbitrary position (white on bottom); 'b' keeps its old meaning
+       of putting black on the bottom of the standard setup */
+    if (argc > 1) {
+        if (strchr(argv[1], '/')) {
+            u8 turn = parseFEN(argv[1], board);
+            if (turn != 0xff) {
+                is_whites_turn = turn;
+                loaded = 1;
+            } else {
+                SDL_Log("Malformed FEN, using start position\n");
+            }
+        } else {
+            u8 k;
+            for (k = 0; k < sizeof(presets) / sizeof(presets[0]); k++) {
+                if (strcmp(argv[1], presets[k].name) == 0) {
+                    is_whites_turn = parseFEN(presets[k].fen, board);
+                    loaded = 1;
+                    break;
+                }
+            }
+        }
+    }
+    if (!loaded)
+        setupBoard(board, (argc > 1) && ((argv[1][0] | 32) == 'b'));
 
-    if (drawBoard(board, renderer, textures, chessboard, &tile) != 0) {
+    if (drawBoard(board, renderer) != 0) {
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
         return 1;
     }
 
-    u8 is_whites_turn = 1, j;
+    u8 j;
     SDL_Event e;
     while (1) {
 	    if (SDL_WaitEvent(&e)) {
@@ -527,10 +1141,10 @@ int main(int argc, char *argv[])
 
                 // If moving piece (clicked on dot)
                 if ((board[i] >> 6) & 1) {
-                    movePiece(board, i);
+                    movePiece(board, g_selected, i);
+                    g_selected = 0xff;
 
-                    if (drawBoard(board, renderer, textures,
-                                  chessboard, &tile) != 0)
+                    if (drawBoard(board, renderer) != 0)
                         break;
                         
                     // Flip turn
@@ -549,31 +1163,38 @@ int main(int argc, char *argv[])
                 // If tile is already selected, deselect
                 if (board[i] >> 7) {
                     board[i] &= 127;
+                    g_selected = 0xff;
                     removeDots(board);
-                    if (drawBoard(board, renderer, textures, chessboard, &tile) != 0)
+                    if (drawBoard(board, renderer) != 0)
                         break;
                     continue;
                 }
 
-                // Tile must be unselected and not a dot then
-                // Unselect any others first
-                for (j = 0; j < 64; j++)
-                    board[j] &= 0x3f;
+                /* Tile must be unselected and not a dot then
+                   Only one square can hold the old selection, so clear
+                   that byte directly instead of sweeping all 64 */
+                if (g_selected != 0xff)
+                    board[g_selected] &= 0x7f;
+                removeDots(board);
 
                 // Select piece
                 board[i] |= 128;
+                g_selected = i;
 
                 // Calculate where dots should go
                 calculateMoves(board, i);
 
-                // Verify dots don't put king in danger
-                for (j = 0; j < 64; j++) {
-                    if (((board[j] >> 6) & 1) &&
-                        (!verifyMove(board, j, is_whites_turn)))
-                        board[j] &= 0xbf;
+                /* Verify dots don't put king in danger - skipped
+                   entirely when this piece provably cannot expose it */
+                if (moveNeedsVerify(board, i)) {
+                    for (j = 0; j < 64; j++) {
+                        if (((board[j] >> 6) & 1) &&
+                            (!verifyMove(board, j, is_whites_turn)))
+                            board[j] &= 0xbf;
+                    }
                 }
 
-                if (drawBoard(board, renderer, textures, chessboard, &tile) != 0)
+                if (drawBoard(board, renderer) != 0)
                     break;
             }
 	    }